@@ -2,7 +2,7 @@
 // @id              fix-w11-explorer-font
 // @name            Fix w11 Explorer Font
 // @description     Customize Windows 11 Explorer font colors and fix theme inconsistencies, especially in dark mode.
-// @version         0.1
+// @version         0.36
 // @author          Turash- Mohaimanul Haque
 // @github          https://github.com/tuurash
 // @include         explorer.exe
@@ -40,6 +40,12 @@ The green value of the text color (0-255).
 - Text Color: Blue (0-255):
 The blue value of the text color (0-255).
 
+- Per-window-class rules:
+Optional list of rules that override the font and color for windows of a
+specific class (e.g. `SysTreeView32` for the navigation pane,
+`tooltips_class32` for tooltips). A matching rule takes precedence over the
+global settings; windows without a matching rule keep the default behavior.
+
 ## System stability:
 
 Explorer Font Changer is heavily tested against GDI handle leaks and there are
@@ -61,8 +67,30 @@ no handles present with your chosen font there!
 - font:
   - name: "None"
     $name: "Font Face Name"
+  - size: 0
+    $name: "Font Size (pt, 0 = default)"
+    $description: >-
+      Override the font point size. The height is scaled per monitor DPI
+      from a table precomputed at settings time; 0 keeps whatever size
+      Windows picked.
+  - sourceMode: false
+    $name: "Replace fonts at creation"
+    $description: >-
+      Apply the custom font when Explorer creates its fonts
+      (CreateFontIndirect) instead of rewriting the font on every draw
+      call. Explorer's own font caches then already hold the substituted
+      font and the draw hooks skip font work entirely. Font creation
+      happens dozens of times per session; drawing happens millions of
+      times.
   - customColor: true
     $name: "Custom text color"
+  - accurateBackground: false
+    $name: "Accurate background detection"
+    $description: >-
+      Sample the actual pixels under the text rectangle instead of trusting
+      the DC's background color. Fixes the custom color misfiring over
+      gradient or image backgrounds in DirectUI panes, at the cost of one
+      small screen capture per window per paint cycle.
   - textR: 255
     $name: "Text Color: Red (0-255)"
   - textG: 255
@@ -71,66 +99,904 @@ no handles present with your chosen font there!
     $name: "Text Color: Blue (0-255)"
   $name: Custom font
   $description: This font will be used for all font creation in Windows.
+- rules:
+  - - class: ""
+      $name: "Window class"
+      $description: >-
+        Exact window class name this rule applies to (e.g. SysListView32
+        for the item list, SysTreeView32 for the navigation pane,
+        tooltips_class32 for tooltips). Leave empty to disable the rule.
+    - font: "None"
+      $name: "Font Face Name"
+    - customColor: false
+      $name: "Custom text color"
+    - textR: 255
+      $name: "Text Color: Red (0-255)"
+    - textG: 255
+      $name: "Text Color: Green (0-255)"
+    - textB: 255
+      $name: "Text Color: Blue (0-255)"
+  $name: Per-window-class rules
+  $description: >-
+    Optional rules that override the font and color for windows of a
+    specific class. A matching rule takes precedence over the global
+    settings; windows without a matching rule keep the default behavior.
+- cacheBudget: 256
+  $name: Cache memory budget (KiB)
+  $description: >-
+    Total memory allotted to the mod's internal caches (replacement fonts,
+    window classifications, text measurements). Allocated once when the mod
+    loads; changing it takes effect the next time the mod is loaded.
+- debug:
+  - statsReport: false
+    $name: "Periodic statistics report"
+    $description: >-
+      Write the hook-coverage counters (per-entry-point call counts,
+      predicate hit/reject rates, cache hit rates) to the mod log every
+      minute. The counters themselves are always collected; they cost a few
+      nanoseconds per draw.
+  - perfStats: false
+    $name: "Performance statistics"
+    $description: >-
+      Measure the time spent inside the mod's hooks and write a latency
+      report (percentiles, call counts) to the mod log when the mod is
+      unloaded.
+  - repaintStats: false
+    $name: "Repaint-storm detection"
+    $description: >-
+      Track recently drawn text and report, in the statistics log, how many
+      draws repeated the same text in the same place within 100 ms —
+      a high ratio points at a shell extension forcing redundant repaints.
+  $name: Debugging
 */
 // ==/WindhawkModSettings==
 
+#ifdef BENCH
+// ===== Benchmark build =====
+//
+// Compile this same file standalone (no Windhawk) to measure the hook body:
+//
+//   clang++ -O2 -DBENCH explorerFontEditor.cpp -lgdi32 -luser32 -lusp10 \
+//       -o bench.exe
+//
+// The Wh_* API is stubbed below with a representative settings profile, and
+// the Wh_SetFunctionHook stub records the target as the "original" without
+// detouring anything — so the hooks fall through to the real GDI functions
+// and the replay loop in main() measures exactly the overhead the mod adds
+// per call.
+#include <windows.h>
+
+#include <cstdio>
+#include <cwchar>
+
+void Wh_Log(PCWSTR format, ...) {}
+
+BOOL Wh_SetFunctionHook(void* targetFunction,
+                        void* hookFunction,
+                        void** originalFunction) {
+    *originalFunction = targetFunction;
+    return TRUE;
+}
+
+int Wh_GetIntSetting(PCWSTR name) {
+    // Representative profile: custom white text color enabled.
+    if (std::wcscmp(name, L"font.customColor") == 0) {
+        return 1;
+    }
+    if (std::wcscmp(name, L"font.textR") == 0 ||
+        std::wcscmp(name, L"font.textG") == 0 ||
+        std::wcscmp(name, L"font.textB") == 0) {
+        return 255;
+    }
+
+    return 0;
+}
+
+namespace WindhawkUtils {
+class StringSetting {
+   public:
+    static StringSetting make(PCWSTR valueName) {
+        // Exercise the font-replacement path; all other string settings
+        // (including the rule list terminator) read as empty.
+        if (std::wcscmp(valueName, L"font.name") == 0) {
+            return StringSetting{L"Segoe UI"};
+        }
+
+        return StringSetting{L""};
+    }
+
+    PCWSTR get() const { return m_value; }
+
+   private:
+    StringSetting(PCWSTR value) : m_value(value) {}
+
+    PCWSTR m_value;
+};
+}  // namespace WindhawkUtils
+#else
 #include <windhawk_utils.h>
+#endif  // BENCH
+
+#include <usp10.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || \
+    defined(__x86_64__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cwchar>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 using namespace std::string_view_literals;
 using namespace WindhawkUtils;
 
 namespace util {
-StringSetting s_font_name;
-bool s_custom_color = true;
-int s_text_r = 255;
-int s_text_g = 255;
-int s_text_b = 255;
-
-// Class to declare transparent RAII types.
-template <class T, auto Fn>
-class raii {
+// FNV-1a over a class name; constexpr so the built-in match sets are hashed
+// at compile time and the runtime does one hash pass plus integer compares
+// instead of chained character-by-character string comparisons.
+constexpr uint64_t hash_class_name(std::wstring_view name) {
+    auto hash = uint64_t{14695981039346656037ull};
+
+    for (auto ch : name) {
+        hash ^= static_cast<uint64_t>(ch);
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// DPI buckets for the precomputed per-DPI height table: the standard
+// 100%–250% scale factors. A window's DPI is resolved to the nearest bucket
+// once, alongside its class hash, in the per-HWND cache.
+constexpr UINT k_dpi_buckets[] = {96, 120, 144, 168, 192, 216, 240};
+constexpr size_t k_dpi_bucket_count = ARRAYSIZE(k_dpi_buckets);
+
+constexpr size_t dpi_to_bucket(UINT dpi) {
+    auto best = size_t{0};
+    auto best_distance = UINT{0xffffffff};
+
+    for (size_t i = 0; i < k_dpi_bucket_count; i++) {
+        auto distance = dpi > k_dpi_buckets[i] ? dpi - k_dpi_buckets[i]
+                                               : k_dpi_buckets[i] - dpi;
+        if (distance < best_distance) {
+            best_distance = distance;
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+// A per-window-class override rule, compiled from the `rules` settings list.
+// Everything is prehashed and prevalidated at settings time so matching on
+// the hot path is one pass over a flat array of integer compares.
+struct rule_t {
+    uint64_t class_hash;
+
+    // Distinguishes this rule's replacement fonts in the font cache (0 is
+    // reserved for the global settings). Stable for the cache's lifetime
+    // since the cache is flushed on every settings change.
+    uint64_t variant;
+
+    WCHAR face_name[LF_FACESIZE];
+    bool has_face;
+
+    bool custom_color;
+    COLORREF text_color;
+};
+
+// Immutable snapshot of everything the draw hooks need from the settings.
+// All derived values (the packed `COLORREF`, the identity flag) are computed
+// once at settings time; the hot path reads a single pointer and never
+// recomputes or tears.
+struct settings_t {
+    // Prevalidated face name, zero-padded to the full `lfFaceName` block so
+    // applying it is a single fixed-size copy with no per-draw length checks.
+    // Only meaningful when `has_face` is set ("None" or an over-long name
+    // leaves the Windows-picked face untouched).
+    WCHAR face_name[LF_FACESIZE];
+    bool has_face;
+
+    // Apply the face at font-creation time (CreateFontIndirect hooks)
+    // instead of per draw call (font.sourceMode).
+    bool source_mode;
+
+    // Optional point-size override (font.size, 0 = keep): `lfHeight`
+    // precomputed per DPI bucket at settings time, so the hook picks a
+    // finished value with one index.
+    LONG heights[k_dpi_bucket_count];
+    bool has_height;
+
+    bool custom_color;
+    COLORREF text_color;
+
+    // Sample real pixels under the draw rect instead of trusting GetBkColor
+    // (font.accurateBackground).
+    bool accurate_background;
+
+    // Per-window-class overrides, in settings order. Empty for most users.
+    std::vector<rule_t> rules;
+
+    // True when the settings ask for no font change ("None"), no custom
+    // color and no rules — i.e. the mod has nothing to do and the hooks
+    // should pass straight through to the originals with zero GDI work.
+    bool identity;
+
+    // Measure hook latency and dump a report on uninit (debug.perfStats).
+    bool perf_stats;
+
+    // Log the coverage counters every minute (debug.statsReport).
+    bool stats_report;
+
+    // Track duplicate draws of identical text/rect (debug.repaintStats).
+    bool repaint_stats;
+};
+
+// Published snapshot. Render threads may still be reading an old snapshot
+// when a new one is swapped in, so old ones are retired to a list instead of
+// freed — they're tiny and settings change rarely, and this keeps the read
+// side a single relaxed-free atomic load with no refcounting.
+std::atomic<const settings_t*> s_settings = nullptr;
+std::mutex s_retired_settings_mutex;
+std::vector<std::unique_ptr<const settings_t>> s_retired_settings;
+
+void update_settings();
+
+// The snapshot is built lazily on first use rather than during mod
+// injection, so `Wh_ModInit` doesn't pay for the settings-store round-trips
+// and the first draw call takes the one-time cost instead. If two threads
+// race the first build, both publish a snapshot and the loser's copy lands
+// harmlessly on the retired list.
+const settings_t& get_settings() {
+    auto* settings = s_settings.load(std::memory_order_acquire);
+
+    if (!settings) [[unlikely]] {
+        update_settings();
+        settings = s_settings.load(std::memory_order_acquire);
+    }
+
+    return *settings;
+}
+
+void publish_settings(std::unique_ptr<const settings_t> settings) {
+    auto previous = s_settings.exchange(settings.release(),
+                                        std::memory_order_acq_rel);
+
+    std::lock_guard guard(s_retired_settings_mutex);
+    s_retired_settings.emplace_back(previous);
+}
+
+void free_all_settings() {
+    std::lock_guard guard(s_retired_settings_mutex);
+
+    delete s_settings.exchange(nullptr, std::memory_order_acq_rel);
+    s_retired_settings.clear();
+}
+
+// Always-on hook-coverage counters. Relaxed atomic increments cost ~1 ns
+// each, cheap enough to leave enabled everywhere; they answer which entry
+// points carry the traffic, how selective each predicate is, and how the
+// caches perform — the data needed to tune the mod per deployment. Dumped
+// through `Wh_Log` at uninit and, when debug.statsReport is on, every
+// minute by the reporter thread.
+struct stats_t {
+    std::atomic<uint64_t> draw_textw_calls;
+    std::atomic<uint64_t> draw_text_exw_calls;
+    std::atomic<uint64_t> ext_text_outw_calls;
+    std::atomic<uint64_t> script_text_out_calls;
+    std::atomic<uint64_t> file_view_hits;
+    std::atomic<uint64_t> file_view_rejects;
+    std::atomic<uint64_t> light_bg_rejects;
+    std::atomic<uint64_t> colors_set;
+    std::atomic<uint64_t> colors_elided;
+    std::atomic<uint64_t> font_cache_hits;
+    std::atomic<uint64_t> font_cache_misses;
+    std::atomic<uint64_t> font_selects_elided;
+    std::atomic<uint64_t> view_cache_hits;
+    std::atomic<uint64_t> view_cache_misses;
+    std::atomic<uint64_t> view_destroy_evictions;
+    std::atomic<uint64_t> measure_cache_hits;
+    std::atomic<uint64_t> measure_cache_misses;
+    std::atomic<uint64_t> classes_learned;
+    std::atomic<uint64_t> repaint_draws;
+    std::atomic<uint64_t> repaint_duplicates;
+};
+
+stats_t s_stats;
+
+// Window seen drawing the most recent duplicate (debug.repaintStats), kept
+// so the report names a concrete HWND to chase with Spy++.
+std::atomic<uint64_t> s_repaint_storm_hwnd = 0;
+
+inline void count(std::atomic<uint64_t>& counter) {
+    counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+void dump_stats_report() {
+    auto load = [](const std::atomic<uint64_t>& counter) {
+        return counter.load(std::memory_order_relaxed);
+    };
+
+    Wh_Log(L"Coverage: DrawTextW=%I64u DrawTextExW=%I64u ExtTextOutW=%I64u "
+           L"ScriptTextOut=%I64u",
+           load(s_stats.draw_textw_calls), load(s_stats.draw_text_exw_calls),
+           load(s_stats.ext_text_outw_calls),
+           load(s_stats.script_text_out_calls));
+    Wh_Log(L"Predicates: fileView hit=%I64u reject=%I64u lightBg "
+           L"reject=%I64u; colors set=%I64u elided=%I64u",
+           load(s_stats.file_view_hits), load(s_stats.file_view_rejects),
+           load(s_stats.light_bg_rejects), load(s_stats.colors_set),
+           load(s_stats.colors_elided));
+    Wh_Log(L"Caches: font hit=%I64u miss=%I64u selectElided=%I64u; "
+           L"view hit=%I64u miss=%I64u evict=%I64u; "
+           L"measure hit=%I64u miss=%I64u; classes learned=%I64u",
+           load(s_stats.font_cache_hits), load(s_stats.font_cache_misses),
+           load(s_stats.font_selects_elided),
+           load(s_stats.view_cache_hits), load(s_stats.view_cache_misses),
+           load(s_stats.view_destroy_evictions),
+           load(s_stats.measure_cache_hits),
+           load(s_stats.measure_cache_misses),
+           load(s_stats.classes_learned));
+
+    if (auto draws = load(s_stats.repaint_draws)) {
+        auto duplicates = load(s_stats.repaint_duplicates);
+        Wh_Log(L"Repaints: draws=%I64u duplicates=%I64u (%I64u%%), last "
+               L"storm hwnd=%08I64X",
+               draws, duplicates, duplicates * 100 / draws,
+               s_repaint_storm_hwnd.load(std::memory_order_relaxed));
+    }
+}
+
+// Reporter thread: wakes once a minute and logs the counters while
+// debug.statsReport is enabled. Started at init, parked on the stop event
+// otherwise, so toggling the setting needs no thread churn.
+constexpr DWORD k_stats_report_period_ms = 60000;
+
+HANDLE s_stats_reporter_thread = nullptr;
+HANDLE s_stats_reporter_stop = nullptr;
+
+DWORD WINAPI stats_reporter_proc(LPVOID) {
+    while (WaitForSingleObject(s_stats_reporter_stop,
+                               k_stats_report_period_ms) == WAIT_TIMEOUT) {
+        if (get_settings().stats_report) {
+            dump_stats_report();
+        }
+    }
+
+    return 0;
+}
+
+void init_stats_reporter() {
+    s_stats_reporter_stop = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (s_stats_reporter_stop) {
+        s_stats_reporter_thread =
+            CreateThread(nullptr, 0, stats_reporter_proc, nullptr, 0, nullptr);
+    }
+}
+
+void stop_stats_reporter() {
+    if (s_stats_reporter_thread) {
+        SetEvent(s_stats_reporter_stop);
+        WaitForSingleObject(s_stats_reporter_thread, 1000);
+        CloseHandle(s_stats_reporter_thread);
+        s_stats_reporter_thread = nullptr;
+    }
+
+    if (s_stats_reporter_stop) {
+        CloseHandle(s_stats_reporter_stop);
+        s_stats_reporter_stop = nullptr;
+    }
+}
+
+// Reentrancy guard: the hook bodies call user32/gdi32 APIs (GetClassNameW,
+// GetParent, GetObjectW) that can themselves draw text through hooked entry
+// points, and DrawTextExW internally funnels into code paths we also hook —
+// so without a guard some themes pay the full hook body twice per logical
+// draw. Nested invocations short-circuit straight to the original function.
+thread_local int s_hook_depth = 0;
+
+class reentrancy_guard_t {
    public:
-    raii() = delete;
-    raii(T handle) : m_handle(handle) {}
-    ~raii() { Fn(m_handle); }
+    reentrancy_guard_t() : m_reentered(s_hook_depth++ > 0) {}
+    ~reentrancy_guard_t() { s_hook_depth--; }
+
+    bool reentered() const { return m_reentered; }
+
+   private:
+    bool m_reentered;
+};
+
+// Hook-latency instrumentation (settings: debug.perfStats). Each thread owns
+// a log2-bucketed histogram of QPC ticks spent inside the hook body, so the
+// hot path records a sample without any synchronization. Histograms are
+// heap-allocated and registered in a global list (never unregistered — a
+// thread that exits simply stops contributing, and explorer keeps a bounded
+// set of render threads), which gets aggregated and dumped through `Wh_Log`
+// at uninit.
+struct latency_histogram_t {
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> buckets[32];
+};
+
+std::mutex s_histograms_mutex;
+std::vector<latency_histogram_t*> s_histograms;
 
-    // we don't need operator= or raii(raii&&) yet...
+latency_histogram_t& get_thread_histogram() {
+    thread_local latency_histogram_t* histogram = [] {
+        auto result = new latency_histogram_t{};
 
-    auto& get() { return m_handle; }
+        std::lock_guard guard(s_histograms_mutex);
+        s_histograms.push_back(result);
 
-    auto get() const { return m_handle; }
+        return result;
+    }();
+
+    return *histogram;
+}
+
+void record_hook_latency(LONGLONG ticks) {
+    auto& histogram = get_thread_histogram();
+
+    auto value = ticks > 0 ? static_cast<uint64_t>(ticks) : uint64_t{1};
+
+    // log2 bucketing: bucket N covers [2^N, 2^(N+1)) ticks.
+    auto bucket = size_t{0};
+    while ((value >>= 1) != 0 && bucket < ARRAYSIZE(histogram.buckets) - 1) {
+        bucket++;
+    }
+
+    histogram.calls.fetch_add(1, std::memory_order_relaxed);
+    histogram.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+// Measures the time spent in a hook body when instrumentation is enabled;
+// costs one branch when it isn't.
+class hook_timer_t {
+   public:
+    hook_timer_t(bool enabled) : m_enabled(enabled) {
+        if (m_enabled) {
+            QueryPerformanceCounter(&m_start);
+        }
+    }
+
+    ~hook_timer_t() {
+        if (m_enabled) {
+            LARGE_INTEGER end;
+            QueryPerformanceCounter(&end);
+            record_hook_latency(end.QuadPart - m_start.QuadPart);
+        }
+    }
 
    private:
-    T m_handle;
+    bool m_enabled;
+    LARGE_INTEGER m_start;
 };
 
-// RAII `HFONT`.
-using unique_hfont_t = raii<HFONT, DeleteObject>;
+void dump_latency_report() {
+    // Aggregate all per-thread histograms.
+    uint64_t calls = 0;
+    uint64_t buckets[32] = {0};
 
-void change_font_in_struct(LOGFONTW* font) {
-    auto font_name = std::wstring_view(s_font_name.get());
+    {
+        std::lock_guard guard(s_histograms_mutex);
 
-    // Check font configuration.
-    if (font_name != L"None"sv) {
-        if (font_name.size() <= 31) {
-            // `face_name` points to a total of 32 WORDs.
-            auto face_name = static_cast<WCHAR*>(font->lfFaceName);
+        for (const auto* histogram : s_histograms) {
+            calls += histogram->calls.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < ARRAYSIZE(buckets); i++) {
+                buckets[i] +=
+                    histogram->buckets[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    if (!calls) {
+        return;
+    }
 
-            std::memset(face_name, 0, ARRAYSIZE(font->lfFaceName));
-            std::memcpy(
-                face_name, font_name.data(),
-                font_name.size() * sizeof(decltype(font_name)::value_type));
-        } else {
-            Wh_Log(L"Trying to change font to \"%s\": size too long (%d)",
-                   font_name.data(), font_name.size());
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+
+    // Reports the upper bound (in ns) of the bucket holding the requested
+    // percentile.
+    auto percentile_ns = [&](double fraction) -> uint64_t {
+        auto threshold = static_cast<uint64_t>(fraction * calls);
+        uint64_t seen = 0;
+
+        for (size_t i = 0; i < ARRAYSIZE(buckets); i++) {
+            seen += buckets[i];
+            if (seen > threshold) {
+                auto upper_ticks = uint64_t{1} << (i + 1);
+                return upper_ticks * 1000000000ull / frequency.QuadPart;
+            }
         }
+
+        return 0;
+    };
+
+    Wh_Log(L"Hook latency: %I64u calls, p50 < %I64u ns, p95 < %I64u ns, "
+           L"p99 < %I64u ns",
+           calls, percentile_ns(0.50), percentile_ns(0.95),
+           percentile_ns(0.99));
+}
+
+void free_histograms() {
+    std::lock_guard guard(s_histograms_mutex);
+
+    for (auto* histogram : s_histograms) {
+        delete histogram;
     }
+
+    s_histograms.clear();
 }
 
-std::pair<unique_hfont_t, LOGFONTW> hdc_update_font(HDC hdc) {
+// Shared cache substrate: the fixed-capacity open-addressing table behind
+// the font, window-verdict, atom and measurement caches. One allocation
+// when the capacity is set (see `init_caches`), a bounded probe window
+// instead of chains, and second-chance (clock) eviction inside the window
+// when it fills — so memory stays flat in a process users keep alive for
+// weeks, and insertion never touches the heap. A mutex per table keeps the
+// locking discipline simple; the bounded window means erasure needs no
+// tombstones since probes always scan the full window.
+constexpr size_t k_cache_probe_window = 8;
+
+template <class Key, class Value, class Hasher>
+class fixed_cache_t {
+   public:
+    // `default_entries` sizes the table if `allocate` is never called (the
+    // normal path sizes all tables from the memory budget at init).
+    explicit fixed_cache_t(size_t default_entries)
+        : m_default_entries(default_entries) {}
+
+    // Rounds down to a power of two so a byte budget is never exceeded;
+    // one-time allocation, no rehash ever.
+    void allocate(size_t entries) {
+        std::lock_guard guard(m_mutex);
+        allocate_slots(entries);
+    }
+
+    size_t slot_size() const { return sizeof(slot_t); }
+
+    bool get(const Key& key, Value* value) {
+        std::lock_guard guard(m_mutex);
+
+        if (auto* slot = find(key)) {
+            slot->referenced = true;
+            *value = slot->value;
+            return true;
+        }
+
+        return false;
+    }
+
+    // Upserts the mapping. Whatever value gets displaced — the same key's
+    // previous value or the clock hand's victim when the probe window is
+    // full — is handed to `on_evict` first, so values owning resources
+    // (the font cache's HFONTs) can retire them.
+    template <class EvictFn>
+    void put(const Key& key, const Value& value, EvictFn on_evict) {
+        std::lock_guard guard(m_mutex);
+
+        if (!m_slots) [[unlikely]] {
+            allocate_slots(m_default_entries);
+        }
+
+        auto index = m_hasher(key);
+        slot_t* free_slot = nullptr;
+        slot_t* victim = nullptr;
+
+        for (size_t i = 0; i < k_cache_probe_window; i++) {
+            auto& slot = m_slots[(index + i) & m_mask];
+
+            if (!slot.used) {
+                if (!free_slot) {
+                    free_slot = &slot;
+                }
+                continue;
+            }
+
+            if (slot.key == key) {
+                on_evict(slot.value);
+                slot.value = value;
+                slot.referenced = false;
+                return;
+            }
+
+            // Clock: strip one chance per pass; the first slot already out
+            // of chances is the victim.
+            if (slot.referenced) {
+                slot.referenced = false;
+            } else if (!victim) {
+                victim = &slot;
+            }
+        }
+
+        if (!free_slot) {
+            if (!victim) {
+                victim = &m_slots[index & m_mask];
+            }
+            on_evict(victim->value);
+            free_slot = victim;
+        }
+
+        free_slot->key = key;
+        free_slot->value = value;
+        free_slot->used = true;
+        free_slot->referenced = false;
+    }
+
+    void put(const Key& key, const Value& value) {
+        put(key, value, [](const Value&) {});
+    }
+
+    bool erase(const Key& key) {
+        std::lock_guard guard(m_mutex);
+
+        if (auto* slot = find(key)) {
+            slot->used = false;
+            return true;
+        }
+
+        return false;
+    }
+
+    template <class EvictFn>
+    void clear(EvictFn on_evict) {
+        std::lock_guard guard(m_mutex);
+
+        for (size_t i = 0; m_slots && i <= m_mask; i++) {
+            if (m_slots[i].used) {
+                on_evict(m_slots[i].value);
+                m_slots[i].used = false;
+            }
+        }
+    }
+
+    void clear() {
+        clear([](const Value&) {});
+    }
+
+   private:
+    struct slot_t {
+        Key key;
+        Value value;
+        bool used;
+        bool referenced;
+    };
+
+    void allocate_slots(size_t entries) {
+        auto capacity = k_cache_probe_window;
+        while (capacity * 2 <= entries) {
+            capacity *= 2;
+        }
+
+        m_slots = std::make_unique<slot_t[]>(capacity);
+        m_mask = capacity - 1;
+    }
+
+    slot_t* find(const Key& key) {
+        if (!m_slots) [[unlikely]] {
+            return nullptr;
+        }
+
+        auto index = m_hasher(key);
+
+        for (size_t i = 0; i < k_cache_probe_window; i++) {
+            auto& slot = m_slots[(index + i) & m_mask];
+            if (slot.used && slot.key == key) {
+                return &slot;
+            }
+        }
+
+        return nullptr;
+    }
+
+    std::mutex m_mutex;
+    std::unique_ptr<slot_t[]> m_slots;
+    size_t m_mask = 0;
+    size_t m_default_entries;
+    Hasher m_hasher;
+};
+
+// Integer and pointer keys need their bits spread before masking into a
+// small table (HWNDs share alignment bits); the murmur3 finalizer is enough.
+inline uint64_t mix_hash(uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ull;
+    value ^= value >> 33;
+    return value;
+}
+
+// Key for the font cache: the source `LOGFONTW` as Explorer handed it to us,
+// before any of our rewrites. Only the fields GDI actually uses for font
+// selection take part in equality/hashing; `lfFaceName` is compared up to the
+// terminating null since `GetObjectW` may leave garbage after it.
+struct font_key_t {
+    LOGFONTW lf;
+
+    // Which face override produced the replacement: 0 for the global
+    // settings, a rule's `variant` otherwise.
+    uint64_t variant;
+
+    // Applied `lfHeight` override (0 = none); the DPI dimension of the key.
+    LONG height;
+
+    bool operator==(const font_key_t& other) const {
+        return variant == other.variant && height == other.height &&
+               lf.lfHeight == other.lf.lfHeight &&
+               lf.lfWidth == other.lf.lfWidth &&
+               lf.lfEscapement == other.lf.lfEscapement &&
+               lf.lfOrientation == other.lf.lfOrientation &&
+               lf.lfWeight == other.lf.lfWeight &&
+               lf.lfItalic == other.lf.lfItalic &&
+               lf.lfUnderline == other.lf.lfUnderline &&
+               lf.lfStrikeOut == other.lf.lfStrikeOut &&
+               lf.lfCharSet == other.lf.lfCharSet &&
+               lf.lfOutPrecision == other.lf.lfOutPrecision &&
+               lf.lfClipPrecision == other.lf.lfClipPrecision &&
+               lf.lfQuality == other.lf.lfQuality &&
+               lf.lfPitchAndFamily == other.lf.lfPitchAndFamily &&
+               std::wcsncmp(lf.lfFaceName, other.lf.lfFaceName,
+                            ARRAYSIZE(lf.lfFaceName)) == 0;
+    }
+};
+
+struct font_key_hash_t {
+    size_t operator()(const font_key_t& key) const {
+        // FNV-1a over the selection-relevant fields.
+        auto hash = uint64_t{14695981039346656037ull};
+        auto mix = [&hash](const void* data, size_t size) {
+            auto bytes = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < size; i++) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+        };
+
+        mix(&key.lf, offsetof(LOGFONTW, lfFaceName));
+        mix(key.lf.lfFaceName,
+            std::wcsnlen(key.lf.lfFaceName, ARRAYSIZE(key.lf.lfFaceName)) *
+                sizeof(WCHAR));
+        mix(&key.variant, sizeof(key.variant));
+        mix(&key.height, sizeof(key.height));
+
+        return static_cast<size_t>(hash);
+    }
+};
+
+// Deferred font deletion. A replacement font dropped from the cache (on a
+// settings flush) can still be selected into a live DC mid-paint, and
+// deleting it right away is both a kernel transition per font and a
+// delete-while-selected hazard (suspected source of glyph corruption under
+// heavy repaint load). Retired fonts instead go into a fixed ring: a font is
+// only actually deleted once the ring has wrapped past it, i.e. after
+// `k_retired_fonts_capacity` newer retirements — long after any in-flight
+// paint that referenced it has finished.
+constexpr size_t k_retired_fonts_capacity = 64;
+
+std::mutex s_retired_fonts_mutex;
+HFONT s_retired_fonts[k_retired_fonts_capacity] = {};
+size_t s_retired_fonts_head = 0;
+
+void retire_font(HFONT h_font) {
+    std::lock_guard guard(s_retired_fonts_mutex);
+
+    // The slot we're about to reuse holds the oldest retiree; it has aged
+    // past a full ring of retirements and is safe to delete now.
+    auto& slot = s_retired_fonts[s_retired_fonts_head];
+    if (slot) {
+        DeleteObject(slot);
+    }
+
+    slot = h_font;
+    s_retired_fonts_head = (s_retired_fonts_head + 1) % k_retired_fonts_capacity;
+}
+
+void drain_retired_fonts() {
+    std::lock_guard guard(s_retired_fonts_mutex);
+
+    for (auto& slot : s_retired_fonts) {
+        if (slot) {
+            DeleteObject(slot);
+            slot = nullptr;
+        }
+    }
+
+    s_retired_fonts_head = 0;
+}
+
+// Cache of long-lived replacement fonts, keyed by the source `LOGFONTW`.
+// Explorer only ever uses a handful of distinct fonts, so after warm-up the
+// draw hooks never touch `CreateFontIndirectW` again. Flushed whenever
+// settings change (the replacement depends on the configured face name);
+// any font the table displaces goes through the retirement ring.
+fixed_cache_t<font_key_t, HFONT, font_key_hash_t> s_font_cache{256};
+
+void flush_font_cache() {
+    s_font_cache.clear(retire_font);
+}
+
+// Applies a settings-time-compiled face block (global or per-rule) to the
+// struct. All validation happened at settings time; this is one branch plus
+// one fixed 64-byte copy of the pre-padded block.
+void change_font_in_struct(const WCHAR* face_name, LOGFONTW* font) {
+    if (face_name) {
+        std::memcpy(font->lfFaceName, face_name, sizeof(font->lfFaceName));
+    }
+}
+
+// Returns the cached replacement for the given source font, face override
+// and height override, creating and caching it on first sight.
+HFONT get_replacement_font(const WCHAR* face_name,
+                           uint64_t variant,
+                           LONG height,
+                           const LOGFONTW& source_font) {
+    auto key = font_key_t{source_font, variant, height};
+
+    HFONT h_cached;
+    if (s_font_cache.get(key, &h_cached)) {
+        count(s_stats.font_cache_hits);
+        return h_cached;
+    }
+
+    count(s_stats.font_cache_misses);
+
+    // Cache miss: build the replacement outside the lock.
+    auto font = source_font;
+    change_font_in_struct(face_name, &font);
+    if (height) {
+        font.lfHeight = height;
+    }
+
+    auto h_new_font = CreateFontIndirectW(&font);
+    if (!h_new_font) {
+        return nullptr;
+    }
+
+    // A racing thread may have inserted its own copy under this key, and a
+    // full probe window evicts a casualty; either way the displaced font may
+    // already be selected into a DC, so it rides the retirement ring rather
+    // than being deleted here.
+    s_font_cache.put(key, h_new_font, retire_font);
+
+    return h_new_font;
+}
+
+// Returns the replacement font selected into the DC, or nullptr if none.
+HFONT hdc_update_font(HDC hdc,
+                      const WCHAR* face_name,
+                      uint64_t variant,
+                      LONG height) {
+    // Per-thread, per-DC font state: consecutive draws in one paint cycle
+    // hit the same DC with our replacement still selected, so remember what
+    // we last selected and for which override. One cheap GetCurrentObject
+    // confirms the DC still holds it (Explorer may re-select its own font
+    // between draws), and the steady state then skips the GetObjectW
+    // round-trip, the cache lookup and the redundant SelectObject.
+    struct memo_t {
+        HDC hdc;
+        HFONT selected;
+        uint64_t variant;
+        LONG height;
+    };
+    thread_local memo_t memo = {};
+
     // Get current selected font.
     auto h_font = GetCurrentObject(hdc, OBJ_FONT);
 
+    if (memo.hdc == hdc && memo.selected == h_font &&
+        memo.variant == variant && memo.height == height) {
+        count(s_stats.font_selects_elided);
+        return memo.selected;
+    }
+
     // Create struct for font.
     auto font = LOGFONTW{0};
 
@@ -138,44 +1004,555 @@ std::pair<unique_hfont_t, LOGFONTW> hdc_update_font(HDC hdc) {
     GetObjectW(static_cast<HANDLE>(h_font), sizeof(font),
                static_cast<LPVOID>(&font));
 
-    // Change font to the font specified in settings.
-    change_font_in_struct(&font);
+    // Select the long-lived replacement font from the cache. The font stays
+    // alive until the next settings change, so nothing needs to be destroyed
+    // when the draw call returns.
+    if (auto h_new_font =
+            get_replacement_font(face_name, variant, height, font)) {
+        SelectObject(hdc, h_new_font);
+        memo = {hdc, h_new_font, variant, height};
+        return h_new_font;
+    }
 
-    // Create new font.
-    auto h_new_font = CreateFontIndirectW(&font);
+    memo = {};
+    return nullptr;
+}
+
+// Startup warm-path. The first folder paint after explorer starts would
+// otherwise pay the cold-cache cost: one `CreateFontIndirectW` per distinct
+// source font, inside a paint cycle. Explorer's font population is
+// predictable — the non-client metrics fonts plus the icon-title font cover
+// nearly all draws — so a short-lived background thread builds their
+// replacements right after init, seeding the font cache (and, as a side
+// effect, taking the one-time settings-snapshot build off the first draw).
+// Only the current system DPI bucket is warmed; other buckets fill on the
+// first draw on their monitor.
+HANDLE s_font_warmer_thread = nullptr;
+
+DWORD WINAPI font_warmer_proc(LPVOID) {
+    // The warm pass runs at hook depth 0, so without this guard its
+    // cache-miss CreateFontIndirectW calls would be rewritten by our own
+    // create hooks in source mode — caching rule variants under the global
+    // face. Raise the depth so the create hooks stay out, same as for any
+    // font we create ourselves.
+    reentrancy_guard_t guard;
+
+    const auto& settings = get_settings();
+    if (settings.identity) {
+        return 0;
+    }
+
+    NONCLIENTMETRICSW metrics = {sizeof(metrics)};
+    if (!SystemParametersInfoW(SPI_GETNONCLIENTMETRICS, sizeof(metrics),
+                               &metrics, 0)) {
+        return 0;
+    }
+
+    auto icon_font = LOGFONTW{};
+    auto has_icon_font = SystemParametersInfoW(
+        SPI_GETICONTITLELOGFONT, sizeof(icon_font), &icon_font, 0);
+
+    const LOGFONTW* sources[] = {
+        &metrics.lfCaptionFont, &metrics.lfSmCaptionFont,
+        &metrics.lfMenuFont,    &metrics.lfStatusFont,
+        &metrics.lfMessageFont, has_icon_font ? &icon_font : nullptr,
+    };
+
+    auto bucket = dpi_to_bucket(GetDpiForSystem());
+    auto height = settings.has_height ? settings.heights[bucket] : 0;
+
+    // Same face/variant combinations `apply_font_and_color` would request:
+    // the global override plus each rule's.
+    auto warm = [&](const WCHAR* face_name, uint64_t variant) {
+        if (!face_name && !height) {
+            return;
+        }
+
+        for (auto* source : sources) {
+            if (source) {
+                get_replacement_font(face_name, variant, height, *source);
+            }
+        }
+    };
+
+    warm(settings.has_face && !settings.source_mode ? settings.face_name
+                                                    : nullptr,
+         0);
+    for (const auto& rule : settings.rules) {
+        warm(rule.has_face ? rule.face_name : nullptr, rule.variant);
+    }
+
+    return 0;
+}
+
+void init_font_warmer() {
+    s_font_warmer_thread =
+        CreateThread(nullptr, 0, font_warmer_proc, nullptr, 0, nullptr);
+}
+
+void stop_font_warmer() {
+    if (s_font_warmer_thread) {
+        WaitForSingleObject(s_font_warmer_thread, 1000);
+        CloseHandle(s_font_warmer_thread);
+        s_font_warmer_thread = nullptr;
+    }
+}
+
+// Prevalidates a configured face name into a zero-padded `lfFaceName`-sized
+// block. Returns false (leaving the block zeroed) for "None" or an over-long
+// name, which means "leave the Windows-picked face untouched".
+bool compile_face_name(std::wstring_view font_name,
+                       WCHAR (&face_name)[LF_FACESIZE]) {
+    std::memset(face_name, 0, sizeof(face_name));
+
+    if (font_name == L"None"sv) {
+        return false;
+    }
+
+    if (font_name.size() >= ARRAYSIZE(face_name)) {
+        Wh_Log(L"Trying to change font to \"%s\": size too long (%d)",
+               font_name.data(), static_cast<int>(font_name.size()));
+        return false;
+    }
+
+    std::memcpy(face_name, font_name.data(), font_name.size() * sizeof(WCHAR));
+    return true;
+}
+
+// Defined with the measurement cache below; the cache entries are keyed on
+// font handles that a settings flush retires.
+void flush_measure_cache();
+
+// Packs three 0-255 settings values into a COLORREF (format: 0x00BBGGRR).
+COLORREF compile_text_color(int r, int g, int b) {
+    return static_cast<COLORREF>(RGB(static_cast<uint8_t>(r & 0xff),
+                                     static_cast<uint8_t>(g & 0xff),
+                                     static_cast<uint8_t>(b & 0xff)));
+}
+
+// True when two snapshots would produce identical replacement fonts — i.e.
+// flushing the font/measurement caches on this settings change would only
+// throw away work. Colors and debug toggles don't participate.
+bool fonts_equivalent(const settings_t& a, const settings_t& b) {
+    if (a.has_face != b.has_face || a.source_mode != b.source_mode ||
+        a.has_height != b.has_height ||
+        std::memcmp(a.face_name, b.face_name, sizeof(a.face_name)) != 0 ||
+        std::memcmp(a.heights, b.heights, sizeof(a.heights)) != 0 ||
+        a.rules.size() != b.rules.size()) {
+        return false;
+    }
 
-    // Select font.
-    SelectObject(hdc, h_new_font);
+    for (size_t i = 0; i < a.rules.size(); i++) {
+        if (a.rules[i].class_hash != b.rules[i].class_hash ||
+            a.rules[i].has_face != b.rules[i].has_face ||
+            std::memcmp(a.rules[i].face_name, b.rules[i].face_name,
+                        sizeof(a.rules[i].face_name)) != 0) {
+            return false;
+        }
+    }
 
-    return {h_new_font, font};
+    return true;
 }
 
+// Reads every settings key exactly once into a fresh snapshot (Windhawk has
+// no batch-read API, so "one pass, no re-fetching" is the best available),
+// publishes it, and flushes the font-keyed caches only if the change
+// actually affects the replacement fonts — a flip of just colors or debug
+// toggles costs nothing but the snapshot swap.
 void update_settings() {
-    s_font_name = StringSetting::make(L"font.name");
-    s_custom_color = Wh_GetIntSetting(L"font.customColor") == 1;
-    s_text_r = Wh_GetIntSetting(L"font.textR");
-    s_text_g = Wh_GetIntSetting(L"font.textG");
-    s_text_b = Wh_GetIntSetting(L"font.textB");
+    auto settings = std::make_unique<settings_t>();
+    settings->rules.reserve(4);
+
+    // Prevalidate the global face name once.
+    auto font_name_setting = StringSetting::make(L"font.name");
+    settings->has_face = compile_face_name(font_name_setting.get(),
+                                           settings->face_name);
+
+    settings->source_mode = Wh_GetIntSetting(L"font.sourceMode") == 1;
+
+    // Precompute `lfHeight` per DPI bucket from the optional point size, so
+    // the draw path never does DPI math.
+    auto size_pt = Wh_GetIntSetting(L"font.size");
+    settings->has_height = size_pt > 0;
+    for (size_t i = 0; i < k_dpi_bucket_count; i++) {
+        settings->heights[i] =
+            settings->has_height
+                ? -MulDiv(size_pt, static_cast<int>(k_dpi_buckets[i]), 72)
+                : 0;
+    }
+
+    settings->custom_color = Wh_GetIntSetting(L"font.customColor") == 1;
+    settings->text_color = compile_text_color(Wh_GetIntSetting(L"font.textR"),
+                                              Wh_GetIntSetting(L"font.textG"),
+                                              Wh_GetIntSetting(L"font.textB"));
+    settings->accurate_background =
+        Wh_GetIntSetting(L"font.accurateBackground") == 1;
+
+    // Compile the per-window-class rules into a flat prehashed table. An
+    // empty class name ends the list.
+    for (int i = 0;; i++) {
+        WCHAR key[64];
+
+        swprintf_s(key, L"rules[%d].class", i);
+        auto class_setting = StringSetting::make(key);
+        auto class_name = std::wstring_view(class_setting.get());
+        if (class_name.empty()) {
+            break;
+        }
+
+        auto rule = rule_t{};
+        rule.class_hash = hash_class_name(class_name);
+        rule.variant = static_cast<uint64_t>(i) + 1;
+
+        swprintf_s(key, L"rules[%d].font", i);
+        auto rule_font_setting = StringSetting::make(key);
+        rule.has_face =
+            compile_face_name(rule_font_setting.get(), rule.face_name);
+
+        swprintf_s(key, L"rules[%d].customColor", i);
+        rule.custom_color = Wh_GetIntSetting(key) == 1;
+
+        swprintf_s(key, L"rules[%d].textR", i);
+        auto rule_r = Wh_GetIntSetting(key);
+        swprintf_s(key, L"rules[%d].textG", i);
+        auto rule_g = Wh_GetIntSetting(key);
+        swprintf_s(key, L"rules[%d].textB", i);
+        auto rule_b = Wh_GetIntSetting(key);
+        rule.text_color = compile_text_color(rule_r, rule_g, rule_b);
+
+        settings->rules.push_back(rule);
+    }
+
+    // In source mode the face is handled at font-creation time, so the draw
+    // hooks have nothing left to do unless colors or rules are configured.
+    settings->identity = (!settings->has_face || settings->source_mode) &&
+                         !settings->has_height && !settings->custom_color &&
+                         settings->rules.empty();
+    settings->perf_stats = Wh_GetIntSetting(L"debug.perfStats") == 1;
+    settings->stats_report = Wh_GetIntSetting(L"debug.statsReport") == 1;
+    settings->repaint_stats = Wh_GetIntSetting(L"debug.repaintStats") == 1;
+
+    const auto* previous = s_settings.load(std::memory_order_acquire);
+    auto keep_caches = previous && fonts_equivalent(*previous, *settings);
+
+    publish_settings(std::move(settings));
+
+    // The cached replacements were built from the old face names, and the
+    // measurement entries are keyed on the now-retired font handles.
+    if (!keep_caches) {
+        flush_font_cache();
+        flush_measure_cache();
+    }
 }
 
-bool is_custom_color_enabled() {
-    return s_custom_color;
+// Asynchronous settings rebuild. `Wh_ModSettingsChanged` arrives on
+// whatever thread Windhawk delivers it on, and rebuilding the snapshot
+// (settings-store round-trips, rule compilation, per-DPI height tables)
+// takes long enough that explorer's UI would hiccup if it ran there during
+// a fleet-wide settings push. A worker thread parked on an auto-reset
+// event does the rebuild instead and publishes the finished snapshot with
+// the usual single atomic swap; bursts of change notifications coalesce
+// into one rebuild naturally because the event stays signaled at most once.
+std::atomic<bool> s_settings_worker_stop = false;
+HANDLE s_settings_worker_thread = nullptr;
+HANDLE s_settings_worker_wake = nullptr;
+
+DWORD WINAPI settings_worker_proc(LPVOID) {
+    while (WaitForSingleObject(s_settings_worker_wake, INFINITE) ==
+           WAIT_OBJECT_0) {
+        if (s_settings_worker_stop.load(std::memory_order_relaxed)) {
+            break;
+        }
+
+        update_settings();
+
+        // A font-affecting change just flushed the cache; re-warm it here,
+        // already off the UI thread, so the post-change repaint is warm too.
+        font_warmer_proc(nullptr);
+    }
+
+    return 0;
 }
 
-COLORREF get_custom_text_color() {
-    // Get the RGB values
-    auto r = static_cast<uint8_t>(s_text_r & 0xff);
-    auto g = static_cast<uint8_t>(s_text_g & 0xff);
-    auto b = static_cast<uint8_t>(s_text_b & 0xff);
+void init_settings_worker() {
+    s_settings_worker_wake = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (s_settings_worker_wake) {
+        s_settings_worker_thread =
+            CreateThread(nullptr, 0, settings_worker_proc, nullptr, 0,
+                         nullptr);
+    }
+}
 
-    // Generate RGB COLORREF (format: 0x00BBGGRR)
-    auto result = static_cast<COLORREF>(RGB(r, g, b));
+// Falls back to the synchronous rebuild if the worker never started —
+// correctness over latency.
+void request_settings_rebuild() {
+    if (s_settings_worker_thread) {
+        SetEvent(s_settings_worker_wake);
+    } else {
+        update_settings();
+    }
+}
 
-    return result;
+void stop_settings_worker() {
+    if (s_settings_worker_thread) {
+        s_settings_worker_stop.store(true, std::memory_order_relaxed);
+        SetEvent(s_settings_worker_wake);
+        WaitForSingleObject(s_settings_worker_thread, 1000);
+        CloseHandle(s_settings_worker_thread);
+        s_settings_worker_thread = nullptr;
+    }
+
+    if (s_settings_worker_wake) {
+        CloseHandle(s_settings_worker_wake);
+        s_settings_worker_wake = nullptr;
+    }
+}
+
+// System theme detection. Inferring the theme per draw from the DC's
+// background color costs a GDI call and misreacts to transiently-set colors
+// (selection-highlight repaints flicker the verdict). The authoritative
+// signal is the `AppsUseLightTheme` registry value: it's read once at init
+// and kept fresh by a watcher thread parked on `RegNotifyChangeKeyValue`, so
+// the hooks read an atomic bool for free. The per-DC luminance check below
+// stays as a fallback for owner-drawn popups that ignore the app theme.
+constexpr PCWSTR k_personalize_key_path =
+    L"Software\\Microsoft\\Windows\\CurrentVersion\\Themes\\Personalize";
+
+std::atomic<bool> s_apps_light_theme = true;
+std::atomic<bool> s_theme_watcher_stop = false;
+HANDLE s_theme_watcher_thread = nullptr;
+HANDLE s_theme_watcher_wake = nullptr;
+
+bool read_apps_light_theme() {
+    DWORD value = 0;
+    DWORD size = sizeof(value);
+
+    if (RegGetValueW(HKEY_CURRENT_USER, k_personalize_key_path,
+                     L"AppsUseLightTheme", RRF_RT_REG_DWORD, nullptr, &value,
+                     &size) != ERROR_SUCCESS) {
+        // Missing value means the default light theme.
+        return true;
+    }
+
+    return value != 0;
+}
+
+DWORD WINAPI theme_watcher_proc(LPVOID) {
+    HKEY key;
+    if (RegOpenKeyExW(HKEY_CURRENT_USER, k_personalize_key_path, 0,
+                      KEY_NOTIFY, &key) != ERROR_SUCCESS) {
+        return 0;
+    }
+
+    while (!s_theme_watcher_stop.load(std::memory_order_relaxed)) {
+        RegNotifyChangeKeyValue(key, FALSE, REG_NOTIFY_CHANGE_LAST_SET,
+                                s_theme_watcher_wake, TRUE);
+        WaitForSingleObject(s_theme_watcher_wake, INFINITE);
+
+        s_apps_light_theme.store(read_apps_light_theme(),
+                                 std::memory_order_relaxed);
+    }
+
+    RegCloseKey(key);
+    return 0;
+}
+
+void init_theme_watcher() {
+    s_apps_light_theme.store(read_apps_light_theme(),
+                             std::memory_order_relaxed);
+
+    s_theme_watcher_wake = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (s_theme_watcher_wake) {
+        s_theme_watcher_thread =
+            CreateThread(nullptr, 0, theme_watcher_proc, nullptr, 0, nullptr);
+    }
+}
+
+void stop_theme_watcher() {
+    if (s_theme_watcher_thread) {
+        s_theme_watcher_stop.store(true, std::memory_order_relaxed);
+        SetEvent(s_theme_watcher_wake);
+        WaitForSingleObject(s_theme_watcher_thread, 1000);
+        CloseHandle(s_theme_watcher_thread);
+        s_theme_watcher_thread = nullptr;
+    }
+
+    if (s_theme_watcher_wake) {
+        CloseHandle(s_theme_watcher_wake);
+        s_theme_watcher_wake = nullptr;
+    }
+}
+
+// Average perceived luminance (0-255) of a block of 32bpp BGRX pixels.
+// Vectorized: per-channel byte sums via SSE2 `_mm_sad_epu8`, four pixels per
+// step — a naive per-pixel loop over a 300×20 label rect per paint would
+// cost more than the rest of the hook combined.
+int average_luminance(const uint32_t* pixels, size_t count) {
+    if (!count) {
+        return 255;
+    }
+
+    uint64_t sum_r = 0;
+    uint64_t sum_g = 0;
+    uint64_t sum_b = 0;
+    size_t i = 0;
+
+#ifdef HAVE_SSE2
+    const auto zero = _mm_setzero_si128();
+    const auto mask_b = _mm_set1_epi32(0x000000ff);
+    const auto mask_g = _mm_set1_epi32(0x0000ff00);
+    const auto mask_r = _mm_set1_epi32(0x00ff0000);
+
+    auto acc_r = zero;
+    auto acc_g = zero;
+    auto acc_b = zero;
+
+    for (; i + 4 <= count; i += 4) {
+        auto px = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(pixels + i));
+
+        acc_b = _mm_add_epi64(acc_b,
+                              _mm_sad_epu8(_mm_and_si128(px, mask_b), zero));
+        acc_g = _mm_add_epi64(
+            acc_g,
+            _mm_sad_epu8(_mm_srli_epi32(_mm_and_si128(px, mask_g), 8), zero));
+        acc_r = _mm_add_epi64(
+            acc_r,
+            _mm_sad_epu8(_mm_srli_epi32(_mm_and_si128(px, mask_r), 16),
+                         zero));
+    }
+
+    auto horizontal_sum = [](const __m128i& acc) {
+        // Through memory rather than `_mm_cvtsi128_si64`, which emmintrin.h
+        // only provides on x64 — mods build for 32-bit explorer too.
+        alignas(16) uint64_t lanes[2];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc);
+        return lanes[0] + lanes[1];
+    };
+
+    sum_b = horizontal_sum(acc_b);
+    sum_g = horizontal_sum(acc_g);
+    sum_r = horizontal_sum(acc_r);
+#endif
+
+    for (; i < count; i++) {
+        auto px = pixels[i];
+        sum_b += px & 0xff;
+        sum_g += (px >> 8) & 0xff;
+        sum_r += (px >> 16) & 0xff;
+    }
+
+    return static_cast<int>(
+        (sum_r * 299 + sum_g * 587 + sum_b * 114) / 1000 / count);
+}
+
+// Accurate mode: sample the pixels actually under the draw rect.
+// `GetBkColor` returns stale white in DirectUI panes that paint gradients or
+// images, so the custom color used to misfire there. The capture is one
+// BitBlt into a 32bpp DIB section read directly in user mode, memoized per
+// (thread, window) for one paint generation — so it runs once per window
+// per paint cycle, not per draw call. Returns -1 when sampling isn't
+// possible and the caller should fall back to `GetBkColor`.
+int sample_background_luminance(HDC hdc, const RECT& rect) {
+    HWND hwnd = WindowFromDC(hdc);
+    if (!hwnd) {
+        return -1;
+    }
+
+    struct memo_t {
+        HWND hwnd;
+        ULONGLONG stamp;
+        int luminance;
+    };
+    thread_local memo_t memo = {};
+
+    auto now = GetTickCount64();
+    if (memo.hwnd == hwnd && memo.stamp == now) {
+        return memo.luminance;
+    }
+
+    // Clamp the sample to keep worst-case cost bounded; a label's luminance
+    // doesn't need every pixel.
+    auto width = std::min<LONG>(rect.right - rect.left, 256);
+    auto height = std::min<LONG>(rect.bottom - rect.top, 32);
+    if (width <= 0 || height <= 0) {
+        return -1;
+    }
+
+    auto bmi = BITMAPINFO{};
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = width;
+    bmi.bmiHeader.biHeight = -height;  // top-down
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    void* bits = nullptr;
+    auto h_bitmap =
+        CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, &bits, nullptr, 0);
+    if (!h_bitmap) {
+        return -1;
+    }
+
+    auto luminance = -1;
+
+    if (auto mem_dc = CreateCompatibleDC(hdc)) {
+        auto h_old = SelectObject(mem_dc, h_bitmap);
+
+        if (BitBlt(mem_dc, 0, 0, width, height, hdc, rect.left, rect.top,
+                   SRCCOPY)) {
+            GdiFlush();
+            luminance = average_luminance(static_cast<const uint32_t*>(bits),
+                                          static_cast<size_t>(width) * height);
+        }
+
+        SelectObject(mem_dc, h_old);
+        DeleteDC(mem_dc);
+    }
+
+    DeleteObject(h_bitmap);
+
+    memo = {hwnd, now, luminance};
+
+    return luminance;
 }
 
 // Check if background is light (context menus, tooltips, etc.)
-bool is_light_background(HDC hdc) {
+//
+// The cached system theme answers first and for free: on a light app theme
+// every themed surface is light. On a dark theme the per-DC luminance check
+// below still runs as a fallback, since owner-drawn popups can be light
+// regardless of the theme.
+//
+// The verdict is memoized per (thread, HDC) for roughly one paint cycle: the
+// background color doesn't change between `DrawTextW` calls inside a single
+// `WM_PAINT`, and `GetTickCount64`'s ~16 ms granularity approximates one
+// frame — so consecutive draws into the same DC skip the `GetBkColor` call
+// and the luminance math entirely.
+bool is_light_background(HDC hdc, const RECT* lprc, bool accurate) {
+    if (s_apps_light_theme.load(std::memory_order_relaxed)) {
+        return true;
+    }
+
+    if (accurate && lprc) {
+        if (auto luminance = sample_background_luminance(hdc, *lprc);
+            luminance >= 0) {
+            return luminance > 128;
+        }
+    }
+
+    struct memo_t {
+        HDC hdc;
+        ULONGLONG stamp;
+        bool light;
+    };
+    thread_local memo_t memo = {};
+
+    auto now = GetTickCount64();
+    if (memo.hdc == hdc && memo.stamp == now) {
+        return memo.light;
+    }
+
     COLORREF bg_color = GetBkColor(hdc);
 
     // Extract RGB components
@@ -187,46 +1564,510 @@ bool is_light_background(HDC hdc) {
     int brightness = (r * 299 + g * 587 + b * 114) / 1000;
 
     // If brightness > 128, it's a light background
-    return brightness > 128;
+    auto light = brightness > 128;
+
+    memo = {hdc, now, light};
+
+    return light;
 }
 
-// Check if we're drawing in the Explorer file/folder view
-bool is_explorer_file_view(HDC hdc) {
-    HWND hwnd = WindowFromDC(hdc);
-    if (!hwnd) {
-        return false;
+// Cached per-window classification. The class-name walk below costs several
+// user32 syscalls per call, but a window's classification never changes
+// during its lifetime — so cache it per HWND. Entries carry a short expiry
+// so a recycled HWND value can't serve stale data for long, and the whole
+// cache is dropped if it somehow grows unbounded.
+struct view_verdict_t {
+    bool is_file_view;
+    // FNV-1a of the window's own class name; what the rule engine matches.
+    uint64_t class_hash;
+    // Index into k_dpi_buckets for the window's monitor DPI.
+    size_t dpi_bucket;
+    ULONGLONG expires_at;
+};
+
+constexpr ULONGLONG k_view_cache_ttl_ms = 2000;
+
+// With the window-lifetime tracker active (see below), destroyed windows
+// are evicted eagerly, so HWND recycling can't serve stale verdicts and the
+// short TTL is no longer needed for correctness. A long refresh interval
+// remains only so a window dragged to a different-DPI monitor eventually
+// picks up its new bucket.
+constexpr ULONGLONG k_view_cache_tracked_ttl_ms = 30000;
+
+std::atomic<bool> s_window_tracking = false;
+
+struct hwnd_hash_t {
+    size_t operator()(HWND hwnd) const {
+        return static_cast<size_t>(
+            mix_hash(reinterpret_cast<uint64_t>(hwnd)));
     }
+};
 
-    // Get window class name
-    WCHAR className[256] = {0};
-    GetClassNameW(hwnd, className, ARRAYSIZE(className));
+fixed_cache_t<HWND, view_verdict_t, hwnd_hash_t> s_view_cache{256};
 
-    // Check if this is a DirectUIHWND window (contains file list view)
-    // or SysListView32 (the actual list view control)
-    std::wstring_view classNameView(className);
+void flush_view_cache() {
+    s_view_cache.clear();
+}
 
-    if (classNameView == L"DirectUIHWND"sv ||
-        classNameView == L"SysListView32"sv) {
-        return true;
+// Window classes whose DC belongs to the Explorer file/folder view:
+// DirectUIHWND (contains the file list view) and SysListView32 (the actual
+// list view control). Extending coverage is one more entry here.
+constexpr uint64_t k_file_view_class_hashes[] = {
+    hash_class_name(L"DirectUIHWND"sv),
+    hash_class_name(L"SysListView32"sv),
+};
+
+constexpr uint64_t k_def_view_class_hash =
+    hash_class_name(L"SHELLDLL_DefView"sv);
+
+bool is_file_view_class_hash(uint64_t hash) {
+    for (auto candidate : k_file_view_class_hashes) {
+        if (hash == candidate) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Class-identification primitive. `GetClassNameW` copies up to 256 WCHARs
+// into a stack buffer per call; the window's class ATOM (`GetClassWord`) is
+// an integer fetch. Atoms are learned on first sighting: the first time an
+// atom shows up its class name is fetched and hashed once, and the
+// atom→hash mapping is kept from then on — so steady-state identification
+// is one syscall-free integer lookup instead of a 512-byte string copy.
+// (A class atom could in principle be unregistered and reused; a stale
+// mapping then just ages out through the table's eviction.)
+struct atom_hash_t {
+    size_t operator()(WORD atom) const {
+        return static_cast<size_t>(mix_hash(atom));
+    }
+};
+
+fixed_cache_t<WORD, uint64_t, atom_hash_t> s_atom_hashes{512};
+
+// Fetches and hashes the class name of the given window.
+uint64_t get_window_class_hash(HWND hwnd) {
+    auto atom = GetClassWord(hwnd, GCW_ATOM);
+
+    uint64_t hash;
+    if (atom && s_atom_hashes.get(atom, &hash)) {
+        return hash;
+    }
+
+    // First sighting of this atom (or an atom-less window): learn the hash.
+    WCHAR class_name[256];
+    auto length = GetClassNameW(hwnd, class_name, ARRAYSIZE(class_name));
+    hash = hash_class_name(
+        std::wstring_view(class_name, length > 0 ? length : 0));
+
+    if (atom) {
+        count(s_stats.classes_learned);
+        s_atom_hashes.put(atom, hash);
     }
 
-    // Also check parent windows up to 3 levels for SHELLDLL_DefView
+    return hash;
+}
+
+// Check parent windows up to 3 levels for SHELLDLL_DefView.
+bool has_def_view_ancestor(HWND hwnd) {
     HWND parent = hwnd;
     for (int i = 0; i < 3; i++) {
         parent = GetParent(parent);
         if (!parent)
             break;
 
-        GetClassNameW(parent, className, ARRAYSIZE(className));
-        std::wstring_view parentClassName(className);
-
-        if (parentClassName == L"SHELLDLL_DefView"sv) {
+        if (get_window_class_hash(parent) == k_def_view_class_hash) {
             return true;
         }
     }
 
     return false;
 }
+
+// Uncached classification of a window: its own class hash plus whether the
+// window (or a near ancestor) is part of the Explorer file/folder view.
+view_verdict_t classify_window(HWND hwnd, ULONGLONG now) {
+    auto class_hash = get_window_class_hash(hwnd);
+    auto is_file_view =
+        is_file_view_class_hash(class_hash) || has_def_view_ancestor(hwnd);
+    auto dpi_bucket = dpi_to_bucket(GetDpiForWindow(hwnd));
+    auto ttl = s_window_tracking.load(std::memory_order_relaxed)
+                   ? k_view_cache_tracked_ttl_ms
+                   : k_view_cache_ttl_ms;
+
+    return {is_file_view, class_hash, dpi_bucket, now + ttl};
+}
+
+// Cached classification of the window backing the DC. Returns a zeroed
+// verdict for DCs without a window.
+view_verdict_t get_window_info(HDC hdc) {
+    HWND hwnd = WindowFromDC(hdc);
+    if (!hwnd) {
+        return {};
+    }
+
+    auto now = GetTickCount64();
+
+    view_verdict_t verdict;
+    if (s_view_cache.get(hwnd, &verdict) && now < verdict.expires_at) {
+        count(s_stats.view_cache_hits);
+        return verdict;
+    }
+
+    count(s_stats.view_cache_misses);
+
+    verdict = classify_window(hwnd, now);
+    s_view_cache.put(hwnd, verdict);
+
+    return verdict;
+}
+
+// Check if we're drawing in the Explorer file/folder view
+bool is_explorer_file_view(HDC hdc) {
+    return get_window_info(hdc).is_file_view;
+}
+
+// Window-lifetime tracking. An in-context WinEvent hook scoped to this
+// process sees EVENT_OBJECT_DESTROY synchronously on the destroying thread,
+// so verdicts are evicted the moment their window dies instead of aging out
+// on the short TTL. Each window is then classified once per lifetime: the
+// classification still happens lazily on the first hooked draw rather than
+// at creation — during WM_CREATE the parent chain isn't wired up yet, so
+// the SHELLDLL_DefView ancestor walk would misclassify, and most windows
+// explorer creates never draw through these hooks anyway.
+HWINEVENTHOOK s_win_event_hook = nullptr;
+
+void CALLBACK win_event_proc(HWINEVENTHOOK,
+                             DWORD event,
+                             HWND hwnd,
+                             LONG id_object,
+                             LONG id_child,
+                             DWORD,
+                             DWORD) {
+    if (event != EVENT_OBJECT_DESTROY || id_object != OBJID_WINDOW ||
+        id_child != CHILDID_SELF || !hwnd) {
+        return;
+    }
+
+    if (s_view_cache.erase(hwnd)) {
+        count(s_stats.view_destroy_evictions);
+    }
+}
+
+void init_window_tracker() {
+    s_win_event_hook = SetWinEventHook(
+        EVENT_OBJECT_DESTROY, EVENT_OBJECT_DESTROY, nullptr, win_event_proc,
+        GetCurrentProcessId(), 0, WINEVENT_INCONTEXT);
+
+    // Falls back to the TTL-only scheme if the hook couldn't be installed.
+    s_window_tracking.store(s_win_event_hook != nullptr,
+                            std::memory_order_relaxed);
+}
+
+void stop_window_tracker() {
+    s_window_tracking.store(false, std::memory_order_relaxed);
+
+    if (s_win_event_hook) {
+        UnhookWinEvent(s_win_event_hook);
+        s_win_event_hook = nullptr;
+    }
+}
+
+// Sets the DC's text color, skipping the gdi32 transition when the DC
+// already holds the exact color we set on a previous draw in the same paint
+// cycle (same per-thread, per-HDC, one-tick-quantum memo scheme as
+// `is_light_background`). In detail views every visible cell hits this path
+// per repaint, so the elision removes one syscall per cell.
+void set_text_color_cached(HDC hdc, COLORREF color) {
+    struct memo_t {
+        HDC hdc;
+        ULONGLONG stamp;
+        COLORREF color;
+    };
+    thread_local memo_t memo = {nullptr, 0, CLR_INVALID};
+
+    // The memo alone isn't proof: Explorer's item-draw code sets its own
+    // text color between our draws (selected vs. unselected rows), so
+    // confirm the DC still holds our color before skipping. GetTextColor
+    // reads a user-mode-cached DC attribute — no kernel transition — so the
+    // elision still saves the SetTextColor call it was added for.
+    auto now = GetTickCount64();
+    if (memo.hdc == hdc && memo.stamp == now && memo.color == color &&
+        GetTextColor(hdc) == color) {
+        count(s_stats.colors_elided);
+        return;
+    }
+
+    SetTextColor(hdc, color);
+    count(s_stats.colors_set);
+    memo = {hdc, now, color};
+}
+
+// Measurement cache for DT_CALCRECT passes. Explorer re-measures the same
+// file names on every resize tick; the computed extents depend only on the
+// selected font, the text, the format flags and the input rect width, so
+// they're cached and served without touching GDI at all. Results are stored
+// relative to the rect's top-left origin. Flushed with the font cache,
+// since font handles key the entries.
+struct measure_key_t {
+    HFONT font;
+    uint64_t text_hash;
+    UINT format;
+    LONG width;
+
+    bool operator==(const measure_key_t& other) const {
+        return font == other.font && text_hash == other.text_hash &&
+               format == other.format && width == other.width;
+    }
+};
+
+struct measure_key_hash_t {
+    size_t operator()(const measure_key_t& key) const {
+        auto hash = key.text_hash;
+        hash ^= reinterpret_cast<uintptr_t>(key.font);
+        hash *= 1099511628211ull;
+        hash ^= (static_cast<uint64_t>(key.format) << 32) |
+                static_cast<uint32_t>(key.width);
+        hash *= 1099511628211ull;
+        return static_cast<size_t>(hash);
+    }
+};
+
+struct measure_result_t {
+    LONG width;
+    LONG height;
+    INT result;
+};
+
+fixed_cache_t<measure_key_t, measure_result_t, measure_key_hash_t>
+    s_measure_cache{4096};
+
+void flush_measure_cache() {
+    s_measure_cache.clear();
+}
+
+uint64_t hash_text(LPCWSTR text, size_t length) {
+    auto hash = uint64_t{14695981039346656037ull};
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= static_cast<uint64_t>(text[i]);
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// Serves a DT_CALCRECT call from the cache, or measures through `original`
+// and caches the result. `h_font` is the replacement font we selected, or
+// nullptr when the DC kept its own font (then the current font is queried
+// once to key the entry).
+template <class DrawFn>
+INT measure_text_cached(HDC hdc,
+                        HFONT h_font,
+                        LPCWSTR text,
+                        INT cch,
+                        LPRECT lprc,
+                        UINT format,
+                        DrawFn original) {
+    // DT_MODIFYSTRING obliges DrawText to rewrite the caller's buffer to
+    // the ellipsized display string (Explorer relies on this for truncated
+    // paths); a cache hit would return the rect but skip that mutation, so
+    // those calls always go through.
+    if (!text || !lprc || (format & DT_MODIFYSTRING)) {
+        return original(hdc, text, cch, lprc, format);
+    }
+
+    if (!h_font) {
+        h_font = static_cast<HFONT>(GetCurrentObject(hdc, OBJ_FONT));
+    }
+
+    auto length = cch == -1 ? std::wcslen(text) : static_cast<size_t>(cch);
+    auto key = measure_key_t{h_font, hash_text(text, length), format,
+                             lprc->right - lprc->left};
+
+    measure_result_t cached;
+    if (s_measure_cache.get(key, &cached)) {
+        count(s_stats.measure_cache_hits);
+        lprc->right = lprc->left + cached.width;
+        lprc->bottom = lprc->top + cached.height;
+        return cached.result;
+    }
+
+    count(s_stats.measure_cache_misses);
+
+    auto result = original(hdc, text, cch, lprc, format);
+    if (result) {
+        s_measure_cache.put(key, {lprc->right - lprc->left,
+                                  lprc->bottom - lprc->top, result});
+    }
+
+    return result;
+}
+
+// Sizes every cache table from the configured memory budget (cacheBudget,
+// in KiB). Runs once at init, before the hooks go live; capacities are
+// fixed from then on, so a changed budget takes effect the next time the
+// mod loads. The split reflects observed populations: measurement entries
+// dominate by count, font entries are few but large.
+constexpr int k_default_cache_budget_kib = 256;
+
+void init_caches() {
+    auto budget_kib = Wh_GetIntSetting(L"cacheBudget");
+    if (budget_kib < 64 || budget_kib > 16384) {
+        budget_kib = k_default_cache_budget_kib;
+    }
+
+    auto budget = static_cast<size_t>(budget_kib) * 1024;
+
+    s_measure_cache.allocate(budget / 2 / s_measure_cache.slot_size());
+    s_font_cache.allocate(budget / 4 / s_font_cache.slot_size());
+    s_view_cache.allocate(budget * 15 / 100 / s_view_cache.slot_size());
+    s_atom_hashes.allocate(budget / 10 / s_atom_hashes.slot_size());
+}
+
+// Repaint-storm detection (debug.repaintStats). Explorer occasionally gets
+// driven into storms of identical draws — same window, same text, same rect,
+// thousands of times within 100 ms — typically by a misbehaving shell
+// extension invalidating the view in a loop, and these hooks are perfectly
+// placed to measure that. Recent draws go into a fixed ring written through
+// a lock-free claimed index; a draw that matches a ring entry younger than
+// the storm window counts as a duplicate. Racy torn reads against a slot
+// being rewritten can miscount the odd draw, which is fine for a
+// diagnostic — taking a lock here would perturb the very storms being
+// measured.
+constexpr size_t k_repaint_ring_size = 128;
+constexpr ULONGLONG k_repaint_window_ms = 100;
+
+struct repaint_entry_t {
+    HWND hwnd;
+    uint64_t text_hash;
+    LONG left;
+    LONG top;
+    ULONGLONG tick;
+};
+
+repaint_entry_t s_repaint_ring[k_repaint_ring_size];
+std::atomic<uint32_t> s_repaint_head = 0;
+
+void record_repaint(HDC hdc, LPCWSTR text, INT cch, const RECT* lprc) {
+    if (!text || !lprc) {
+        return;
+    }
+
+    HWND hwnd = WindowFromDC(hdc);
+    if (!hwnd) {
+        return;
+    }
+
+    count(s_stats.repaint_draws);
+
+    auto length = cch == -1 ? std::wcslen(text) : static_cast<size_t>(cch);
+    auto hash = hash_text(text, length);
+    auto now = GetTickCount64();
+
+    for (const auto& entry : s_repaint_ring) {
+        if (entry.hwnd == hwnd && entry.text_hash == hash &&
+            entry.left == lprc->left && entry.top == lprc->top &&
+            now - entry.tick <= k_repaint_window_ms) {
+            count(s_stats.repaint_duplicates);
+            s_repaint_storm_hwnd.store(
+                reinterpret_cast<uint64_t>(hwnd), std::memory_order_relaxed);
+            break;
+        }
+    }
+
+    auto slot = s_repaint_head.fetch_add(1, std::memory_order_relaxed) %
+                k_repaint_ring_size;
+    s_repaint_ring[slot] = {hwnd, hash, lprc->left, lprc->top, now};
+}
+
+// Shared hook core: applies the cached replacement font and, when the
+// predicates pass, the custom text color to the DC. Every hooked text entry
+// point funnels through here so new entry points don't multiply the per-call
+// logic. `replace_font` is false for entry points that receive pre-shaped
+// glyph indices — substituting the font after shaping would draw the wrong
+// glyphs, so those only get the color treatment.
+// Returns the replacement font selected into the DC (nullptr if the DC
+// keeps its own font), which doubles as the font identity for the
+// measurement cache.
+inline HFONT apply_font_and_color(const settings_t& settings,
+                                  HDC hdc,
+                                  const RECT* lprc,
+                                  bool replace_font = true) {
+    // One cached window lookup serves the rule engine, the DPI bucket and
+    // the file-view gate; skipped entirely for configurations that need
+    // none of them.
+    auto info = view_verdict_t{};
+    if (!settings.rules.empty() || settings.has_height ||
+        settings.custom_color) {
+        info = get_window_info(hdc);
+    }
+
+    // Rule lookup: one pass over the flat prehashed table, matched against
+    // the cached per-window class hash. Skipped entirely when no rules are
+    // configured, which is the common case.
+    const rule_t* rule = nullptr;
+    for (const auto& candidate : settings.rules) {
+        if (candidate.class_hash == info.class_hash) {
+            rule = &candidate;
+            break;
+        }
+    }
+
+    HFONT h_selected = nullptr;
+
+    if (replace_font) {
+        const WCHAR* face_name = nullptr;
+        auto variant = uint64_t{0};
+
+        if (rule) {
+            face_name = rule->has_face ? rule->face_name : nullptr;
+            variant = rule->variant;
+        } else if (settings.has_face && !settings.source_mode) {
+            // In source mode the global face was already substituted when
+            // Explorer created the font; rule faces still apply at draw
+            // time since they depend on the target window.
+            face_name = settings.face_name;
+        }
+
+        auto height =
+            settings.has_height ? settings.heights[info.dpi_bucket] : 0;
+
+        // Update font on HDC to the cached settings font, from current
+        // HFONT. Nothing to do when no override applies.
+        if (face_name || height) {
+            h_selected = hdc_update_font(hdc, face_name, variant, height);
+        }
+    }
+
+    // A matching rule fully overrides the color behavior for its class.
+    // Windows without a rule keep the defaults: custom text color ONLY for
+    // file/folder names in Explorer view, skipping non-file-view windows
+    // (address bar, ribbon, etc.) and light backgrounds (context menus).
+    // The file-view check runs first: it's the most selective predicate and
+    // fully cached.
+    auto accurate = settings.accurate_background;
+
+    if (rule) {
+        if (rule->custom_color && !is_light_background(hdc, lprc, accurate)) {
+            set_text_color_cached(hdc, rule->text_color);
+        }
+    } else if (settings.custom_color) {
+        count(info.is_file_view ? s_stats.file_view_hits
+                                : s_stats.file_view_rejects);
+
+        if (info.is_file_view) {
+            if (!is_light_background(hdc, lprc, accurate)) {
+                set_text_color_cached(hdc, settings.text_color);
+            } else {
+                count(s_stats.light_bg_rejects);
+            }
+        }
+    }
+
+    return h_selected;
+}
 }  // namespace util
 
 using draw_textw_hook_t = decltype(&DrawTextW);
@@ -235,20 +2076,45 @@ static draw_textw_hook_t draw_textw_original = nullptr;
 using draw_text_exw_hook_t = decltype(&DrawTextExW);
 static draw_text_exw_hook_t draw_text_exw_original = nullptr;
 
+using ext_text_outw_hook_t = decltype(&ExtTextOutW);
+static ext_text_outw_hook_t ext_text_outw_original = nullptr;
+
+using script_text_out_hook_t = decltype(&ScriptTextOut);
+static script_text_out_hook_t script_text_out_original = nullptr;
+
+using create_font_indirectw_hook_t = decltype(&CreateFontIndirectW);
+static create_font_indirectw_hook_t create_font_indirectw_original = nullptr;
+
+using create_font_indirect_exw_hook_t = decltype(&CreateFontIndirectExW);
+static create_font_indirect_exw_hook_t create_font_indirect_exw_original =
+    nullptr;
+
 INT WINAPI draw_textw_hook(HDC hdc,
                            LPCWSTR lpchText,
                            INT cchText,
                            LPRECT lprc,
                            UINT format) {
-    // Update font on HDC to settings font, from current HFONT.
-    auto [h_new_font, _] = util::hdc_update_font(hdc);
+    util::count(util::s_stats.draw_textw_calls);
+    util::reentrancy_guard_t guard;
+    const auto& settings = util::get_settings();
+    util::hook_timer_t timer(settings.perf_stats && !guard.reentered());
+
+    if (settings.repaint_stats && !guard.reentered() &&
+        !(format & DT_CALCRECT)) {
+        util::record_repaint(hdc, lpchText, cchText, lprc);
+    }
 
-    // Apply custom text color ONLY to file/folder names in Explorer view
-    // Skip: light backgrounds (context menus), non-file-view windows (address
-    // bar, ribbon, etc.)
-    if (util::is_custom_color_enabled() && !util::is_light_background(hdc) &&
-        util::is_explorer_file_view(hdc)) {
-        SetTextColor(hdc, util::get_custom_text_color());
+    // Nothing configured (or we're nested inside our own hook body): don't
+    // touch the DC at all.
+    if (!guard.reentered() && !settings.identity) {
+        auto h_font = util::apply_font_and_color(settings, hdc, lprc);
+
+        // Measurement-only passes are served from the extent cache.
+        if (format & DT_CALCRECT) {
+            return util::measure_text_cached(hdc, h_font, lpchText, cchText,
+                                             lprc, format,
+                                             draw_textw_original);
+        }
     }
 
     return draw_textw_original(hdc, lpchText, cchText, lprc, format);
@@ -260,45 +2126,298 @@ INT WINAPI draw_text_exw_hook(HDC hdc,
                               LPRECT lprc,
                               UINT format,
                               LPDRAWTEXTPARAMS lpdtp) {
-    // Update font on HDC to settings font, from current HFONT.
-    auto [h_new_font, _] = util::hdc_update_font(hdc);
+    util::count(util::s_stats.draw_text_exw_calls);
+    util::reentrancy_guard_t guard;
+    const auto& settings = util::get_settings();
+    util::hook_timer_t timer(settings.perf_stats && !guard.reentered());
+
+    if (settings.repaint_stats && !guard.reentered() &&
+        !(format & DT_CALCRECT)) {
+        util::record_repaint(hdc, lpchText, cchText, lprc);
+    }
 
-    // Apply custom text color ONLY to file/folder names in Explorer view
-    // Skip: light backgrounds (context menus), non-file-view windows (address
-    // bar, ribbon, etc.)
-    if (util::is_custom_color_enabled() && !util::is_light_background(hdc) &&
-        util::is_explorer_file_view(hdc)) {
-        SetTextColor(hdc, util::get_custom_text_color());
+    // Nothing configured (or we're nested inside our own hook body): don't
+    // touch the DC at all.
+    if (!guard.reentered() && !settings.identity) {
+        auto h_font = util::apply_font_and_color(settings, hdc, lprc);
+
+        // Measurement-only passes are served from the extent cache; only
+        // with no DRAWTEXTPARAMS, whose in/out fields the cache can't model.
+        if ((format & DT_CALCRECT) && !lpdtp) {
+            return util::measure_text_cached(
+                hdc, h_font, lpchText, cchText, lprc, format,
+                [](HDC hdc, LPCWSTR text, INT cch, LPRECT rect, UINT fmt) {
+                    return draw_text_exw_original(
+                        hdc, const_cast<LPWSTR>(text), cch, rect, fmt,
+                        nullptr);
+                });
+        }
     }
 
     return draw_text_exw_original(hdc, lpchText, cchText, lprc, format, lpdtp);
 }
 
+BOOL WINAPI ext_text_outw_hook(HDC hdc,
+                               int x,
+                               int y,
+                               UINT options,
+                               const RECT* lprect,
+                               LPCWSTR lpString,
+                               UINT c,
+                               const INT* lpDx) {
+    util::count(util::s_stats.ext_text_outw_calls);
+    util::reentrancy_guard_t guard;
+    const auto& settings = util::get_settings();
+    util::hook_timer_t timer(settings.perf_stats && !guard.reentered());
+
+    if (!guard.reentered() && !settings.identity) {
+        // With ETO_GLYPH_INDEX the string is glyph indices shaped against
+        // the currently selected font; swapping the font here would render
+        // garbage, so only the color is applied in that case.
+        util::apply_font_and_color(settings, hdc, lprect,
+                                   !(options & ETO_GLYPH_INDEX));
+    }
+
+    return ext_text_outw_original(hdc, x, y, options, lprect, lpString, c,
+                                  lpDx);
+}
+
+HRESULT WINAPI script_text_out_hook(const HDC hdc,
+                                    SCRIPT_CACHE* psc,
+                                    int x,
+                                    int y,
+                                    UINT fuOptions,
+                                    const RECT* lprc,
+                                    const SCRIPT_ANALYSIS* psa,
+                                    const WCHAR* pwcReserved,
+                                    int iReserved,
+                                    const WORD* pwGlyphs,
+                                    int cGlyphs,
+                                    const int* piAdvance,
+                                    const int* piJustify,
+                                    const GOFFSET* pGoffset) {
+    util::count(util::s_stats.script_text_out_calls);
+    util::reentrancy_guard_t guard;
+    const auto& settings = util::get_settings();
+    util::hook_timer_t timer(settings.perf_stats && !guard.reentered());
+
+    if (!guard.reentered() && !settings.identity) {
+        // Uniscribe hands us glyphs already shaped against the selected
+        // font (and a SCRIPT_CACHE tied to it) — font substitution at this
+        // stage would mismatch the glyph ids, so color only.
+        util::apply_font_and_color(settings, hdc, lprc,
+                                   /*replace_font=*/false);
+    }
+
+    return script_text_out_original(hdc, psc, x, y, fuOptions, lprc, psa,
+                                    pwcReserved, iReserved, pwGlyphs, cGlyphs,
+                                    piAdvance, piJustify, pGoffset);
+}
+
+// Source-mode hooks: rewrite the face when Explorer creates the font, so
+// Explorer's own font caches hold the substituted font and the draw hooks
+// skip font work entirely. Font creation happens dozens of times per
+// session vs. millions of draws. The reentrancy guard keeps our own
+// CreateFontIndirectW calls (font cache misses) from being rewritten twice.
+HFONT WINAPI create_font_indirectw_hook(const LOGFONTW* lplf) {
+    util::reentrancy_guard_t guard;
+    const auto& settings = util::get_settings();
+
+    if (!guard.reentered() && settings.source_mode && settings.has_face &&
+        lplf) {
+        auto font = *lplf;
+        util::change_font_in_struct(settings.face_name, &font);
+        return create_font_indirectw_original(&font);
+    }
+
+    return create_font_indirectw_original(lplf);
+}
+
+HFONT WINAPI create_font_indirect_exw_hook(const ENUMLOGFONTEXDVW* lpelf) {
+    util::reentrancy_guard_t guard;
+    const auto& settings = util::get_settings();
+
+    if (!guard.reentered() && settings.source_mode && settings.has_face &&
+        lpelf) {
+        auto font = *lpelf;
+        util::change_font_in_struct(settings.face_name,
+                                    &font.elfEnumLogfontEx.elfLogFont);
+        return create_font_indirect_exw_original(&font);
+    }
+
+    return create_font_indirect_exw_original(lpelf);
+}
+
+// Hook descriptor table: one row per hooked entry point, grouped by module
+// so installation makes one pass with one module resolution per group.
+// Adding an entry point is its hook function plus one row here; the table
+// also doubles as the enumeration surface for coverage analysis.
+struct hook_descriptor_t {
+    PCWSTR module;
+    PCSTR function;
+    void* hook;
+    void** original;
+};
+
+static const hook_descriptor_t k_hooks[] = {
+    {L"user32.dll", "DrawTextW", reinterpret_cast<void*>(draw_textw_hook),
+     reinterpret_cast<void**>(&draw_textw_original)},
+    {L"user32.dll", "DrawTextExW",
+     reinterpret_cast<void*>(draw_text_exw_hook),
+     reinterpret_cast<void**>(&draw_text_exw_original)},
+    // DirectUI renders column headers and some tooltips through ExtTextOutW
+    // and Uniscribe rather than DrawTextW; hook those too for full coverage.
+    {L"gdi32.dll", "ExtTextOutW",
+     reinterpret_cast<void*>(ext_text_outw_hook),
+     reinterpret_cast<void**>(&ext_text_outw_original)},
+    {L"gdi32.dll", "CreateFontIndirectW",
+     reinterpret_cast<void*>(create_font_indirectw_hook),
+     reinterpret_cast<void**>(&create_font_indirectw_original)},
+    {L"gdi32.dll", "CreateFontIndirectExW",
+     reinterpret_cast<void*>(create_font_indirect_exw_hook),
+     reinterpret_cast<void**>(&create_font_indirect_exw_original)},
+    // usp10 is loaded by the shell early, but don't force it in if absent —
+    // its hooks are simply skipped then.
+    {L"usp10.dll", "ScriptTextOut",
+     reinterpret_cast<void*>(script_text_out_hook),
+     reinterpret_cast<void**>(&script_text_out_original)},
+};
+
 BOOL Wh_ModInit() {
-    // Get settings before applying hooks.
-    util::update_settings();
+    // Settings are parsed lazily on the first hooked draw (see
+    // util::get_settings) to keep injection-path work minimal — explorer
+    // restarts at login load dozens of mods and init time adds up.
+    util::init_caches();
+    util::init_theme_watcher();
+    util::init_stats_reporter();
+    util::init_settings_worker();
+    util::init_window_tracker();
+    util::init_font_warmer();
+
+    // One pass over the descriptor table. GetModuleHandleW (no loader-lock
+    // round-trip — the modules are already loaded in explorer.exe) is
+    // called once per module group thanks to the table's ordering.
+    HMODULE module = nullptr;
+    PCWSTR module_name = nullptr;
+
+    for (const auto& descriptor : k_hooks) {
+        if (module_name != descriptor.module) {
+            module_name = descriptor.module;
+            module = GetModuleHandleW(module_name);
+        }
 
-    auto user32 = LoadLibraryW(L"user32.dll");
+        if (!module) {
+            Wh_Log(L"Skipping %S: %s not loaded", descriptor.function,
+                   descriptor.module);
+            continue;
+        }
 
-    auto draw_textw = reinterpret_cast<draw_textw_hook_t>(
-        GetProcAddress(user32, "DrawTextW"));
-    Wh_SetFunctionHook(reinterpret_cast<void*>(draw_textw),
-                       reinterpret_cast<void*>(draw_textw_hook),
-                       reinterpret_cast<void**>(&draw_textw_original));
+        auto target =
+            reinterpret_cast<void*>(GetProcAddress(module,
+                                                   descriptor.function));
+        if (!target) {
+            Wh_Log(L"Skipping %S: not found in %s", descriptor.function,
+                   descriptor.module);
+            continue;
+        }
 
-    auto draw_text_exw = reinterpret_cast<draw_text_exw_hook_t>(
-        GetProcAddress(user32, "DrawTextExW"));
-    Wh_SetFunctionHook(reinterpret_cast<void*>(draw_text_exw),
-                       reinterpret_cast<void*>(draw_text_exw_hook),
-                       reinterpret_cast<void**>(&draw_text_exw_original));
+        Wh_SetFunctionHook(target, descriptor.hook, descriptor.original);
+    }
 
     return TRUE;
 }
 
 void Wh_ModSettingsChanged() {
-    util::update_settings();
+    util::request_settings_rebuild();
 }
 
 void Wh_ModUninit() {
+    util::stop_font_warmer();
+    util::stop_window_tracker();
+    util::stop_settings_worker();
+    util::stop_stats_reporter();
+    util::stop_theme_watcher();
+    util::dump_stats_report();
+    util::dump_latency_report();
+    util::free_histograms();
+    util::flush_font_cache();
+    util::flush_measure_cache();
+    util::drain_retired_fonts();
+    util::free_all_settings();
+
     Wh_Log(L"Uninit");
 }
+
+#ifdef BENCH
+int main() {
+    Wh_ModInit();
+
+    // Memory DC with a typical source font selected, standing in for the
+    // window DCs Explorer hands the hooks. No HWND backs a memory DC, so the
+    // classification path resolves to "not a file view" — the benchmark
+    // covers the font-replacement path plus predicate overhead.
+    HDC hdc = CreateCompatibleDC(nullptr);
+
+    auto source_font = LOGFONTW{0};
+    source_font.lfHeight = -12;
+    wcscpy_s(source_font.lfFaceName, L"MS Shell Dlg 2");
+    HFONT h_source_font = CreateFontIndirectW(&source_font);
+    SelectObject(hdc, h_source_font);
+
+    // Representative replay stream: file names of assorted lengths, some
+    // with DT_CALCRECT the way Explorer measures strings before layout.
+    struct draw_record_t {
+        PCWSTR text;
+        LONG width;
+        UINT format;
+    };
+    constexpr draw_record_t records[] = {
+        {L"Documents", 200, DT_SINGLELINE},
+        {L"New Text Document.txt", 200, DT_SINGLELINE | DT_END_ELLIPSIS},
+        {L"Q3 budget review (final) v7.xlsx", 180,
+         DT_SINGLELINE | DT_END_ELLIPSIS},
+        {L"IMG_20240131_093212.jpg", 160, DT_SINGLELINE},
+        {L"Documents", 200, DT_CALCRECT | DT_SINGLELINE},
+        {L"New Text Document.txt", 200, DT_CALCRECT | DT_SINGLELINE},
+    };
+
+    constexpr int k_iterations = 2000000;
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+
+    auto replay = [&](auto&& draw) {
+        LARGE_INTEGER start, end;
+        QueryPerformanceCounter(&start);
+
+        for (int i = 0; i < k_iterations; i++) {
+            const auto& record = records[i % ARRAYSIZE(records)];
+            RECT rect = {0, 0, record.width, 20};
+            draw(hdc, record.text, -1, &rect, record.format);
+        }
+
+        QueryPerformanceCounter(&end);
+
+        return (end.QuadPart - start.QuadPart) * 1000000000.0 /
+               frequency.QuadPart / k_iterations;
+    };
+
+    // Baseline first (unhooked DrawTextW), then the hook body; the delta is
+    // the mod's per-call cost.
+    auto baseline_ns = replay(draw_textw_original);
+    auto hooked_ns = replay(draw_textw_hook);
+
+    std::printf("%d calls each\n", k_iterations);
+    std::printf("DrawTextW baseline: %8.1f ns/call\n", baseline_ns);
+    std::printf("hooked:             %8.1f ns/call\n", hooked_ns);
+    std::printf("hook overhead:      %8.1f ns/call\n",
+                hooked_ns - baseline_ns);
+
+    Wh_ModUninit();
+
+    DeleteDC(hdc);
+    DeleteObject(h_source_font);
+
+    return 0;
+}
+#endif  // BENCH